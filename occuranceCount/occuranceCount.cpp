@@ -20,9 +20,29 @@
 #include "indri/LocalQueryServer.hpp"
 #include "indri/ScopedLock.hpp"
 #include "indri/QueryEnvironment.hpp"
+#include "indri/IndriTimer.hpp"
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <set>
+#include <map>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string.hpp>
 
@@ -188,6 +208,43 @@ void print_file_count_p( const std::string& indexName, const std::string& expres
 }
 */
 
+//
+// Runs task(0) .. task(count-1) on up to threadCount threads.  The first
+// exception thrown by a task stops the remaining work and is rethrown on
+// the calling thread once all workers have finished.
+//
+
+void run_parallel( size_t count, int threadCount, const std::function<void (size_t)>& task ) {
+  std::atomic<size_t> next( 0 );
+  std::vector<std::thread> workers;
+  std::exception_ptr failure;
+  std::mutex failureLock;
+  if( threadCount < 1 )
+    threadCount = 1;
+
+  for( int t=0; t<threadCount && (size_t) t<count; t++ ) {
+    workers.push_back( std::thread( [&]() {
+      size_t i;
+      while( (i = next++) < count ) {
+        try {
+          task( i );
+        } catch( ... ) {
+          std::lock_guard<std::mutex> guard( failureLock );
+          if( !failure )
+            failure = std::current_exception();
+          next = count;
+        }
+      }
+    } ) );
+  }
+
+  for( size_t t=0; t<workers.size(); t++ )
+    workers[t].join();
+
+  if( failure )
+    std::rethrow_exception( failure );
+}
+
 void print_file_count( const std::string& indexName, const std::string& expression ) {
   indri::api::QueryEnvironment env;
 
@@ -268,6 +325,1054 @@ void print_expression_list( const std::string& indexName, const std::string& exp
   }
 }
 
+//
+// Window expressions.  A small evaluator for the subset of the Indri
+// query language that the feature files use: terms, #odN / #N ordered
+// windows and #uwN unordered windows, nested freely.  Unlike
+// QueryEnvironment::expressionList, it works one document at a time, so
+// callers can stream extents without holding the whole result list.
+//
+// Matching follows Indri's window operators: #od and #uw without a width
+// are unlimited, #odN allows fewer than N positions between consecutive
+// children, #uwN needs all children within N positions, and an unordered
+// window binds each child to its own occurrence whatever their order.
+// Matches of one window do not overlap.  Deleted documents are skipped.
+// windowcheck (wc) diffs these counts against fx/dx on a real index and
+// should be run before feature values from it replace Indri's.
+//
+
+struct WindowExtent {
+  int begin;
+  int end;
+};
+
+struct WindowExpression {
+  enum Type { TERM, ORDERED, UNORDERED };
+
+  Type type;
+  int window;        // -1 means the whole document
+  std::string term;  // stem, for TERM nodes
+  std::vector<WindowExpression*> children;
+
+  WindowExpression() : type(TERM), window(-1) {}
+  ~WindowExpression() {
+    for( size_t i=0; i<children.size(); i++ )
+      delete children[i];
+  }
+};
+
+static WindowExpression* parse_window_node( indri::collection::Repository& r, const std::string& text, size_t& pos ) {
+  while( pos < text.size() && isspace( (unsigned char) text[pos] ) )
+    pos++;
+  if( pos >= text.size() || text[pos] == ')' )
+    return 0;
+
+  WindowExpression* node = new WindowExpression;
+
+  if( text[pos] != '#' ) {
+    size_t start = pos;
+    while( pos < text.size() && !isspace( (unsigned char) text[pos] ) && text[pos] != '(' && text[pos] != ')' )
+      pos++;
+    node->term = r.processTerm( text.substr( start, pos - start ) );
+    return node;
+  }
+
+  size_t start = ++pos;
+  while( pos < text.size() && text[pos] != '(' )
+    pos++;
+  std::string op = text.substr( start, pos - start );
+  size_t digits = op.find_first_of( "0123456789" );
+  std::string name = op.substr( 0, digits );
+
+  // as in Indri's parser, a window without a width is unlimited
+  if( name == "" || name == "od" ) {
+    node->type = WindowExpression::ORDERED;
+  } else if( name == "uw" ) {
+    node->type = WindowExpression::UNORDERED;
+  } else {
+    delete node;
+    LEMUR_THROW( LEMUR_PARSE_ERROR, "Unsupported operator in window expression: #" + op );
+  }
+  if( digits != std::string::npos )
+    node->window = atoi( op.c_str() + digits );
+
+  if( pos >= text.size() ) {
+    delete node;
+    LEMUR_THROW( LEMUR_PARSE_ERROR, "Missing '(' in window expression: " + text );
+  }
+  pos++;
+
+  WindowExpression* child;
+  while( (child = parse_window_node( r, text, pos )) != 0 ) {
+    // stopwords stem to nothing and are dropped, as the query parser does
+    if( child->type == WindowExpression::TERM && child->term.empty() )
+      delete child;
+    else
+      node->children.push_back( child );
+  }
+
+  if( pos >= text.size() ) {
+    delete node;
+    LEMUR_THROW( LEMUR_PARSE_ERROR, "Missing ')' in window expression: " + text );
+  }
+  pos++;
+
+  // #4( illegally ) is just the term
+  if( node->children.size() == 1 && node->children[0]->type == WindowExpression::TERM ) {
+    child = node->children[0];
+    node->children.clear();
+    delete node;
+    return child;
+  }
+
+  return node;
+}
+
+WindowExpression* parse_window_expression( indri::collection::Repository& r, const std::string& text ) {
+  size_t pos = 0;
+  WindowExpression* root = parse_window_node( r, text, pos );
+
+  while( pos < text.size() && isspace( (unsigned char) text[pos] ) )
+    pos++;
+  if( root == 0 || pos != text.size() ) {
+    delete root;
+    LEMUR_THROW( LEMUR_PARSE_ERROR, "Expected a single window expression: " + text );
+  }
+
+  return root;
+}
+
+void collect_window_terms( const WindowExpression* node, std::set<std::string>& terms ) {
+  if( node->type == WindowExpression::TERM ) {
+    if( node->term.size() )
+      terms.insert( node->term );
+    return;
+  }
+
+  for( size_t i=0; i<node->children.size(); i++ )
+    collect_window_terms( node->children[i], terms );
+}
+
+typedef std::map< std::string, std::vector<int> > WindowPositions;
+
+//
+// Searches for an extent of each child from `child` on (skipping `fixed`,
+// which is already bound) at or after its cursor and disjoint from every
+// bound extent, lowering best to the smallest end of such an assignment.
+//
+
+static void bind_unordered_children( const std::vector< std::vector<WindowExtent> >& lists, const std::vector<size_t>& cursors,
+                                     size_t child, size_t fixed, std::vector<WindowExtent>& bound, int end, int& best ) {
+  if( child == lists.size() ) {
+    best = std::min( best, end );
+    return;
+  }
+
+  if( child == fixed ) {
+    bind_unordered_children( lists, cursors, child + 1, fixed, bound, end, best );
+    return;
+  }
+
+  for( size_t k=cursors[child]; k<lists[child].size(); k++ ) {
+    const WindowExtent& candidate = lists[child][k];
+    // extents are in begin order and end after they begin
+    if( candidate.begin >= best || end >= best )
+      break;
+
+    bool overlaps = false;
+    for( size_t b=0; b<bound.size() && !overlaps; b++ )
+      overlaps = candidate.begin < bound[b].end && bound[b].begin < candidate.end;
+    if( overlaps )
+      continue;
+
+    bound.push_back( candidate );
+    bind_unordered_children( lists, cursors, child + 1, fixed, bound, std::max( end, candidate.end ), best );
+    bound.pop_back();
+  }
+}
+
+//
+// Combines the extents of a window's children (each non-empty, in begin
+// order) into the window's own extents.  Matches of a window do not
+// overlap: the search for the next match starts after the previous one.
+//
+
+void combine_window_extents( WindowExpression::Type type, int window,
+                             const std::vector< std::vector<WindowExtent> >& lists, std::vector<WindowExtent>& extents ) {
+  size_t count = lists.size();
+  int lastEnd = -1;
+  extents.clear();
+
+  std::vector<size_t> cursors( count, 0 );
+
+  if( type == WindowExpression::ORDERED ) {
+    // the earliest extent following each child only moves forward as the
+    // first child advances, so one cursor per child is enough
+    for( size_t f=0; f<lists[0].size(); f++ ) {
+      if( lists[0][f].begin < lastEnd )
+        continue;
+
+      WindowExtent previous = lists[0][f];
+      bool matched = true;
+
+      for( size_t i=1; i<count && matched; i++ ) {
+        while( cursors[i] < lists[i].size() && lists[i][cursors[i]].begin < previous.end )
+          cursors[i]++;
+
+        matched = cursors[i] < lists[i].size() &&
+          ( window < 0 || lists[i][cursors[i]].begin - previous.end < window );
+        if( matched )
+          previous = lists[i][cursors[i]];
+      }
+
+      if( matched ) {
+        WindowExtent extent = { lists[0][f].begin, previous.end };
+        extents.push_back( extent );
+        lastEnd = extent.end;
+      }
+    }
+    return;
+  }
+
+  // unordered: every child extent may start a window; the other children
+  // are bound by an exhaustive search for the disjoint extents with the
+  // smallest end, so the result does not depend on the children's order
+  std::vector< std::pair< int, std::pair<size_t, size_t> > > starts;
+  for( size_t i=0; i<count; i++ )
+    for( size_t j=0; j<lists[i].size(); j++ )
+      starts.push_back( std::make_pair( lists[i][j].begin, std::make_pair( i, j ) ) );
+  std::sort( starts.begin(), starts.end() );
+
+  std::vector<WindowExtent> bound;
+
+  for( size_t s=0; s<starts.size(); s++ ) {
+    int begin = starts[s].first;
+    if( begin < lastEnd )
+      continue;
+
+    for( size_t i=0; i<count; i++ )
+      while( cursors[i] < lists[i].size() && lists[i][cursors[i]].begin < begin )
+        cursors[i]++;
+
+    size_t first = starts[s].second.first;
+    bound.assign( 1, lists[first][starts[s].second.second] );
+
+    // best is one past the largest acceptable end
+    int best = ( window < 0 ) ? INT_MAX : begin + window + 1;
+    bind_unordered_children( lists, cursors, 0, first, bound, bound[0].end, best );
+
+    if( window < 0 ? best != INT_MAX : best <= begin + window ) {
+      WindowExtent extent = { begin, best };
+      extents.push_back( extent );
+      lastEnd = best;
+    }
+  }
+}
+
+//
+// Computes the extents of a window expression in one document, given the
+// positions of every stem in that document.
+//
+
+void evaluate_window_expression( const WindowExpression* node, const WindowPositions& positions, std::vector<WindowExtent>& extents ) {
+  extents.clear();
+
+  if( node->type == WindowExpression::TERM ) {
+    WindowPositions::const_iterator found = positions.find( node->term );
+    if( found == positions.end() )
+      return;
+
+    for( size_t i=0; i<found->second.size(); i++ ) {
+      WindowExtent extent = { found->second[i], found->second[i] + 1 };
+      extents.push_back( extent );
+    }
+    return;
+  }
+
+  size_t count = node->children.size();
+  if( count == 0 )
+    return;
+
+  std::vector< std::vector<WindowExtent> > lists( count );
+  for( size_t i=0; i<count; i++ ) {
+    evaluate_window_expression( node->children[i], positions, lists[i] );
+    if( lists[i].empty() )
+      return;
+  }
+
+  combine_window_extents( node->type, node->window, lists, extents );
+}
+
+class WindowExtentVisitor {
+public:
+  virtual ~WindowExtentVisitor() {}
+  // return false to stop the walk
+  virtual bool visit( lemur::api::DOCID_T document, int length, const std::vector<WindowExtent>& extents ) = 0;
+};
+
+//
+// A document sample for approximate counts.  Document IDs are cut into
+// blocks of WINDOW_SAMPLE_BLOCK documents and a fraction rate of the
+// blocks is kept: uniformly at random (by a hash of the block number), or
+// stratified, one block in every 1/rate.  Keeping whole blocks lets a
+// walk skip the postings between them.
+//
+
+#define WINDOW_SAMPLE_BLOCK 1024
+
+struct WindowSample {
+  double rate;
+  bool stratified;
+  lemur::api::DOCID_T maxDocument;
+
+  bool containsBlock( UINT64 block ) const {
+    if( stratified )
+      return floor( (block + 1) * rate ) > floor( block * rate );
+
+    // splitmix64 finalizer
+    UINT64 h = block + 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    h = h ^ (h >> 31);
+    return (h >> 11) * (1.0 / 9007199254740992.0) < rate;
+  }
+
+  bool contains( lemur::api::DOCID_T document ) const {
+    return containsBlock( document / WINDOW_SAMPLE_BLOCK );
+  }
+
+  // first sampled document at or after document, or 0 if there is none
+  lemur::api::DOCID_T next( lemur::api::DOCID_T document ) const {
+    for( UINT64 block = document / WINDOW_SAMPLE_BLOCK; block * WINDOW_SAMPLE_BLOCK <= (UINT64) maxDocument; block++ ) {
+      if( containsBlock( block ) )
+        return std::max( document, (lemur::api::DOCID_T) (block * WINDOW_SAMPLE_BLOCK) );
+    }
+    return 0;
+  }
+};
+
+//
+// Walks every document that contains all the given stems, one document
+// at a time, in each index partition, handing each document's positions
+// to the callback (which returns false to stop).  Only the current
+// document's positions are held in memory.  With a sample, documents
+// outside the sampled blocks are skipped.
+//
+
+typedef std::function<bool (lemur::api::DOCID_T, int, const WindowPositions&)> WindowDocumentCallback;
+
+void walk_window_documents( indri::collection::Repository& r, const std::set<std::string>& terms, const WindowDocumentCallback& callback,
+                            const WindowSample* sample = 0 ) {
+  if( terms.empty() )
+    return;
+
+  indri::collection::Repository::index_state state = r.indexes();
+  indri::index::DeletedDocumentList& deleted = r.deletedList();
+  WindowPositions positions;
+
+  bool more = true;
+
+  for( size_t s=0; s<state->size() && more; s++ ) {
+    indri::index::Index* index = (*state)[s];
+    indri::thread::ScopedLock lock( index->iteratorLock() );
+
+    std::vector<std::string> stems( terms.begin(), terms.end() );
+    std::vector<indri::index::DocListIterator*> iters;
+    for( size_t i=0; i<stems.size(); i++ ) {
+      indri::index::DocListIterator* iter = index->docListIterator( stems[i] );
+      if( iter == NULL )
+        break;
+      iter->startIteration();
+      iters.push_back( iter );
+    }
+
+    bool complete = ( iters.size() == stems.size() );
+
+    while( more && complete ) {
+      lemur::api::DOCID_T document = 0;
+      for( size_t i=0; i<iters.size() && complete; i++ ) {
+        if( iters[i]->finished() )
+          complete = false;
+        else
+          document = std::max( document, iters[i]->currentEntry()->document );
+      }
+      if( !complete )
+        break;
+
+      if( sample && !sample->contains( document ) ) {
+        document = sample->next( document );
+        if( document == 0 )
+          break;
+      }
+
+      bool aligned = true;
+      for( size_t i=0; i<iters.size(); i++ ) {
+        if( iters[i]->currentEntry()->document < document ) {
+          iters[i]->nextEntry( document );
+          aligned = false;
+        }
+      }
+      if( !aligned )
+        continue;
+
+      if( !deleted.isDeleted( document ) ) {
+        positions.clear();
+        for( size_t i=0; i<iters.size(); i++ ) {
+          indri::index::DocListIterator::DocumentData* entry = iters[i]->currentEntry();
+          positions[stems[i]].assign( entry->positions.begin(), entry->positions.end() );
+        }
+
+        more = callback( document, index->documentLength( document ), positions );
+      }
+
+      for( size_t i=0; i<iters.size(); i++ )
+        iters[i]->nextEntry();
+    }
+
+    for( size_t i=0; i<iters.size(); i++ )
+      delete iters[i];
+  }
+}
+
+void walk_window_expression( indri::collection::Repository& r, const WindowExpression* expression, WindowExtentVisitor& visitor,
+                             const WindowSample* sample = 0 ) {
+  std::set<std::string> terms;
+  collect_window_terms( expression, terms );
+  std::vector<WindowExtent> extents;
+
+  walk_window_documents( r, terms, [&]( lemur::api::DOCID_T document, int length, const WindowPositions& positions ) {
+    evaluate_window_expression( expression, positions, extents );
+    return extents.empty() || visitor.visit( document, length, extents );
+  }, sample );
+}
+
+//
+// Posting list cache.  Decoded doc/position lists keyed by stem, merged
+// across all index partitions and without deleted documents, shared by the commands that count many
+// expressions over inverted lists in this process.  Entries are evicted
+// least recently used first once the decoded size of the cached lists
+// passes POSTING_CACHE_MB megabytes from the environment (default 1024).
+// The budget covers cached lists only; lists still held by a running
+// thread after eviction come on top of it.  A list whose decoded size,
+// estimated from the partitions' term statistics, exceeds the whole
+// budget is never decoded: get() returns null and callers stream it from
+// the index instead.  Lookups are safe from concurrent threads; a list
+// missed by two threads at once may be decoded twice, but only one copy
+// is kept.
+//
+
+struct PostingList {
+  std::vector<lemur::api::DOCID_T> documents;
+  std::vector<int> lengths;
+  std::vector<size_t> offsets;  // positions of documents[i] are [offsets[i], offsets[i+1])
+  std::vector<int> positions;
+
+  size_t bytes() const {
+    return sizeof(PostingList) +
+      documents.size() * sizeof(lemur::api::DOCID_T) +
+      lengths.size() * sizeof(int) +
+      offsets.size() * sizeof(size_t) +
+      positions.size() * sizeof(int);
+  }
+};
+
+typedef std::shared_ptr<const PostingList> PostingListPtr;
+
+class PostingCache {
+private:
+  typedef std::list<std::string> recency_list;
+  struct Entry {
+    PostingListPtr list;
+    recency_list::iterator recency;
+  };
+
+  std::mutex _lock;
+  std::map<std::string, Entry> _entries;
+  recency_list _recency;
+  size_t _bytes;
+  size_t _budget;
+
+  UINT64 _hits;
+  UINT64 _misses;
+  UINT64 _evictions;
+  UINT64 _oversize;
+
+  static size_t _estimate( indri::collection::Repository& r, const std::string& stem ) {
+    indri::collection::Repository::index_state state = r.indexes();
+    UINT64 documents = 0;
+    UINT64 positions = 0;
+
+    for( size_t s=0; s<state->size(); s++ ) {
+      documents += (*state)[s]->documentCount( stem );
+      positions += (*state)[s]->termCount( stem );
+    }
+
+    return sizeof(PostingList) +
+      documents * ( sizeof(lemur::api::DOCID_T) + sizeof(int) + sizeof(size_t) ) +
+      positions * sizeof(int);
+  }
+
+  static PostingList* _decode( indri::collection::Repository& r, const std::string& stem ) {
+    PostingList* list = new PostingList;
+    indri::collection::Repository::index_state state = r.indexes();
+    indri::index::DeletedDocumentList& deleted = r.deletedList();
+
+    for( size_t s=0; s<state->size(); s++ ) {
+      indri::index::Index* index = (*state)[s];
+      indri::thread::ScopedLock lock( index->iteratorLock() );
+
+      indri::index::DocListIterator* iter = index->docListIterator( stem );
+      if( iter == NULL )
+        continue;
+
+      for( iter->startIteration(); iter->finished() == false; iter->nextEntry() ) {
+        indri::index::DocListIterator::DocumentData* entry = iter->currentEntry();
+        if( deleted.isDeleted( entry->document ) )
+          continue;
+
+        list->documents.push_back( entry->document );
+        list->lengths.push_back( index->documentLength( entry->document ) );
+        list->offsets.push_back( list->positions.size() );
+        list->positions.insert( list->positions.end(), entry->positions.begin(), entry->positions.end() );
+      }
+
+      delete iter;
+    }
+
+    list->offsets.push_back( list->positions.size() );
+    return list;
+  }
+
+public:
+  PostingCache() : _bytes(0), _hits(0), _misses(0), _evictions(0), _oversize(0) {
+    const char* megabytes = getenv( "POSTING_CACHE_MB" );
+    _budget = (size_t) ( ( megabytes ? atof( megabytes ) : 1024.0 ) * 1024 * 1024 );
+  }
+
+  PostingListPtr get( indri::collection::Repository& r, const std::string& stem ) {
+    {
+      std::lock_guard<std::mutex> guard( _lock );
+      std::map<std::string, Entry>::iterator found = _entries.find( stem );
+      if( found != _entries.end() ) {
+        _recency.splice( _recency.begin(), _recency, found->second.recency );
+        _hits++;
+        return found->second.list;
+      }
+      _misses++;
+    }
+
+    if( _estimate( r, stem ) > _budget ) {
+      std::lock_guard<std::mutex> guard( _lock );
+      _oversize++;
+      return PostingListPtr();
+    }
+
+    PostingListPtr list( _decode( r, stem ) );
+    size_t bytes = list->bytes();
+
+    std::lock_guard<std::mutex> guard( _lock );
+    std::map<std::string, Entry>::iterator found = _entries.find( stem );
+    if( found != _entries.end() )
+      return found->second.list;
+
+    while( _bytes + bytes > _budget && _recency.size() ) {
+      std::map<std::string, Entry>::iterator victim = _entries.find( _recency.back() );
+      _bytes -= victim->second.list->bytes();
+      _entries.erase( victim );
+      _recency.pop_back();
+      _evictions++;
+    }
+
+    _recency.push_front( stem );
+    Entry& entry = _entries[stem];
+    entry.list = list;
+    entry.recency = _recency.begin();
+    _bytes += bytes;
+
+    return list;
+  }
+
+  UINT64 lookups() {
+    std::lock_guard<std::mutex> guard( _lock );
+    return _hits + _misses;
+  }
+
+  void printStatistics( std::ostream& out ) {
+    std::lock_guard<std::mutex> guard( _lock );
+    out << "posting cache: " << _hits << " hits, " << _misses << " misses, "
+        << _evictions << " evictions, " << _oversize << " oversize, " << _entries.size() << " lists, "
+        << _bytes << " of " << _budget << " bytes" << std::endl;
+  }
+};
+
+PostingCache& posting_cache() {
+  static PostingCache cache;
+  return cache;
+}
+
+//
+// Same walk as walk_window_documents, but over cached posting lists,
+// which makes it safe to call from several threads at once.  With a
+// sample, the cursors jump straight to the next sampled block.  If any
+// list is too large to cache, the walk streams from the index instead.
+//
+
+void walk_cached_window_documents( indri::collection::Repository& r, const std::set<std::string>& terms, const WindowDocumentCallback& callback,
+                                   const WindowSample* sample = 0 ) {
+  if( terms.empty() )
+    return;
+
+  std::vector<std::string> stems( terms.begin(), terms.end() );
+  std::vector<PostingListPtr> lists;
+  for( size_t i=0; i<stems.size(); i++ ) {
+    lists.push_back( posting_cache().get( r, stems[i] ) );
+    if( !lists.back() ) {
+      walk_window_documents( r, terms, callback, sample );
+      return;
+    }
+    if( lists.back()->documents.empty() )
+      return;
+  }
+
+  std::vector<size_t> cursors( lists.size(), 0 );
+  WindowPositions positions;
+
+  while( true ) {
+    lemur::api::DOCID_T document = 0;
+    for( size_t i=0; i<lists.size(); i++ ) {
+      if( cursors[i] == lists[i]->documents.size() )
+        return;
+      document = std::max( document, lists[i]->documents[cursors[i]] );
+    }
+
+    if( sample && !sample->contains( document ) ) {
+      document = sample->next( document );
+      if( document == 0 )
+        return;
+    }
+
+    bool aligned = true;
+    for( size_t i=0; i<lists.size(); i++ ) {
+      const std::vector<lemur::api::DOCID_T>& documents = lists[i]->documents;
+      if( documents[cursors[i]] < document ) {
+        cursors[i] = std::lower_bound( documents.begin() + cursors[i], documents.end(), document ) - documents.begin();
+        aligned = false;
+      }
+    }
+    if( !aligned )
+      continue;
+
+    positions.clear();
+    for( size_t i=0; i<lists.size(); i++ ) {
+      const PostingList& list = *lists[i];
+      positions[stems[i]].assign( list.positions.begin() + list.offsets[cursors[i]],
+                                  list.positions.begin() + list.offsets[cursors[i] + 1] );
+    }
+
+    if( !callback( document, lists[0]->lengths[cursors[0]], positions ) )
+      return;
+
+    for( size_t i=0; i<cursors.size(); i++ )
+      cursors[i]++;
+  }
+}
+
+//
+// Same walk as walk_window_expression, but over cached posting lists,
+// which makes it safe to call from several threads at once.
+//
+
+void walk_cached_window_expression( indri::collection::Repository& r, const WindowExpression* expression, WindowExtentVisitor& visitor,
+                                    const WindowSample* sample = 0 ) {
+  std::set<std::string> terms;
+  collect_window_terms( expression, terms );
+  std::vector<WindowExtent> extents;
+
+  walk_cached_window_documents( r, terms, [&]( lemur::api::DOCID_T document, int length, const WindowPositions& positions ) {
+    evaluate_window_expression( expression, positions, extents );
+    return extents.empty() || visitor.visit( document, length, extents );
+  }, sample );
+}
+
+class WindowCountVisitor : public WindowExtentVisitor {
+public:
+  UINT64 occurrences;
+  UINT64 documents;
+
+  WindowCountVisitor() : occurrences(0), documents(0) {}
+
+  bool visit( lemur::api::DOCID_T, int, const std::vector<WindowExtent>& extents ) {
+    occurrences += extents.size();
+    documents++;
+    return true;
+  }
+};
+
+//
+// Counts the occurrences or, with documents set, the matching documents
+// of every window expression in a file, in the fx output format, using
+// the window expression evaluator in parallel over the posting cache.
+// Output is in file order.
+//
+
+void print_window_file_count( indri::collection::Repository& r, const std::string& fileName, bool documents, int threadCount ) {
+  ifstream file( fileName.c_str() );
+  std::string line;
+  std::vector<std::string> expressions;
+
+  while( std::getline( file, line, '\n' ) )
+    expressions.push_back( line );
+
+  // stemming goes through the repository's shared parser, so parse serially
+  std::vector<WindowExpression*> roots( expressions.size() );
+  for( size_t i=0; i<expressions.size(); i++ )
+    roots[i] = parse_window_expression( r, expressions[i] );
+
+  std::vector<UINT64> counts( expressions.size(), 0 );
+
+  run_parallel( expressions.size(), threadCount, [&]( size_t i ) {
+    WindowCountVisitor visitor;
+    walk_cached_window_expression( r, roots[i], visitor );
+    counts[i] = documents ? visitor.documents : visitor.occurrences;
+  } );
+
+  for( size_t i=0; i<expressions.size(); i++ ) {
+    std::cout << expressions[i] << ":" << counts[i] << std::endl;
+    delete roots[i];
+  }
+}
+
+//
+// Cross-checks the window expression evaluator against Indri.  For every
+// expression in the file, prints Indri's occurrence and document counts
+// (as fx and dx report them) next to the evaluator's (as wfx and wdx
+// report them), and marks lines where they differ:
+//
+//   expression:indriCount:windowCount:indriDocuments:windowDocuments[:MISMATCH]
+//
+// Returns the number of mismatching expressions.
+//
+
+int print_window_check( const std::string& indexName, indri::collection::Repository& r, const std::string& fileName ) {
+  ifstream file( fileName.c_str() );
+  std::string line;
+  indri::api::QueryEnvironment env;
+  int mismatches = 0;
+
+  env.addIndex( indexName );
+
+  while( std::getline( file, line, '\n' ) ) {
+    WindowExpression* root = parse_window_expression( r, line );
+    WindowCountVisitor visitor;
+    walk_cached_window_expression( r, root, visitor );
+    delete root;
+
+    UINT64 indriCount = (UINT64) env.expressionCount( line );
+    UINT64 indriDocuments = (UINT64) env.documentExpressionCount( line );
+    bool mismatch = ( indriCount != visitor.occurrences || indriDocuments != visitor.documents );
+
+    std::cout << line << ":" << indriCount << ":" << visitor.occurrences
+              << ":" << indriDocuments << ":" << visitor.documents;
+    if( mismatch ) {
+      std::cout << ":MISMATCH";
+      mismatches++;
+    }
+    std::cout << std::endl;
+  }
+
+  env.close();
+  return mismatches;
+}
+
+//
+// Window width tables.  Each line of the file is a tuple of window
+// expression nodes (terms, or phrases such as #1(human illness)),
+// optionally followed by :docno,docno,... naming a top document set.
+// Each tuple's postings are swept once over the posting cache, and for
+// every width N up to maxWindow the number of #odN(tuple) and #uwN(tuple)
+// matches is recorded, both collection-wide and within the top documents.
+// Because window matches never overlap, the count at N is not a prefix
+// sum of one span-length histogram, so each width is combined separately
+// from the same per-document child extents; the index is still read only
+// once per tuple.  Output, one line per tuple, scope and operator:
+//
+//   tuple:all|top:od|uw:count1,count2,...,countN
+//
+
+struct WindowTable {
+  std::string tuple;
+  WindowExpression* root;
+  std::vector<const WindowExpression*> children;
+  std::set<lemur::api::DOCID_T> topDocuments;
+  // [all od, all uw, top od, top uw][width]
+  std::vector<UINT64> counts[4];
+};
+
+void print_window_table( indri::collection::Repository& r, const std::string& fileName, int maxWindow, int threadCount ) {
+  if( maxWindow < 1 )
+    LEMUR_THROW( LEMUR_BAD_PARAMETER_ERROR, "maxWindow must be at least 1" );
+
+  indri::collection::CompressedCollection* collection = r.collection();
+
+  ifstream file( fileName.c_str() );
+  std::string line;
+  std::vector<WindowTable> tables;
+
+  while( std::getline( file, line, '\n' ) ) {
+    size_t colon = line.find( ':' );
+    WindowTable table;
+    table.tuple = line.substr( 0, colon );
+
+    if( colon != std::string::npos ) {
+      std::string topDocs = line.substr( colon + 1 );
+      std::vector<std::string> docnos;
+      boost::split( docnos, topDocs, boost::is_any_of( "," ) );
+      for( size_t i=0; i<docnos.size(); i++ ) {
+        boost::trim( docnos[i] );
+        if( docnos[i].empty() )
+          continue;
+        std::vector<lemur::api::DOCID_T> ids = collection->retrieveIDByMetadatum( "docno", docnos[i] );
+        table.topDocuments.insert( ids.begin(), ids.end() );
+      }
+    }
+
+    table.root = parse_window_expression( r, "#uw(" + table.tuple + ")" );
+    if( table.root->type == WindowExpression::TERM )
+      table.children.push_back( table.root );
+    else
+      table.children.assign( table.root->children.begin(), table.root->children.end() );
+
+    for( int i=0; i<4; i++ )
+      table.counts[i].resize( maxWindow + 1, 0 );
+    tables.push_back( table );
+  }
+
+  run_parallel( tables.size(), threadCount, [&]( size_t t ) {
+    WindowTable& table = tables[t];
+    std::set<std::string> terms;
+    collect_window_terms( table.root, terms );
+
+    std::vector< std::vector<WindowExtent> > lists( table.children.size() );
+    std::vector<WindowExtent> extents;
+
+    walk_cached_window_documents( r, terms, [&]( lemur::api::DOCID_T document, int, const WindowPositions& positions ) {
+      for( size_t i=0; i<lists.size(); i++ ) {
+        evaluate_window_expression( table.children[i], positions, lists[i] );
+        if( lists[i].empty() )
+          return true;
+      }
+
+      bool top = table.topDocuments.count( document ) > 0;
+
+      for( int width=1; width<=maxWindow; width++ ) {
+        combine_window_extents( WindowExpression::ORDERED, width, lists, extents );
+        table.counts[0][width] += extents.size();
+        if( top )
+          table.counts[2][width] += extents.size();
+
+        combine_window_extents( WindowExpression::UNORDERED, width, lists, extents );
+        table.counts[1][width] += extents.size();
+        if( top )
+          table.counts[3][width] += extents.size();
+      }
+
+      return true;
+    } );
+  } );
+
+  const char* labels[4] = { "all:od", "all:uw", "top:od", "top:uw" };
+
+  for( size_t t=0; t<tables.size(); t++ ) {
+    for( int i=0; i<4; i++ ) {
+      if( i >= 2 && tables[t].topDocuments.empty() )
+        continue;
+
+      std::cout << tables[t].tuple << ":" << labels[i] << ":";
+      for( int width=1; width<=maxWindow; width++ )
+        std::cout << tables[t].counts[i][width] << ( width < maxWindow ? "," : "" );
+      std::cout << std::endl;
+    }
+
+    delete tables[t].root;
+  }
+}
+
+//
+// Approximate wfx/wdx counts.  Each window expression in the file is
+// evaluated only over a WindowSample of the documents, over the posting
+// cache, and the count is scaled by 1/rate.  Sampled blocks are clusters, so the variance is
+// estimated from the per-block totals Y as (1 - rate) / rate^2 * sum(Y^2)
+// and reported as estimate +/- z standard errors (the observed count is a
+// hard lower bound).  That is the Bernoulli sampling estimator; in
+// stratified mode the blocks are systematic, not independent, so the
+// interval there is only an approximation.  When a threshold is given,
+// expressions whose interval contains it are recounted over all
+// documents.  Expressions are screened in parallel.  Output, in file
+// order:
+//
+//   expression:estimate:low:high:sampled|counted
+//
+// where counted lines (recounts, or a rate of 1) have low == high ==
+// estimate.  A counted value is exact for the window evaluator only; it
+// can differ from Indri's fx/dx, which windowcheck (wc) reports.
+//
+
+class SampleCountVisitor : public WindowExtentVisitor {
+private:
+  bool _documents;
+  UINT64 _block;
+  UINT64 _blockTotal;
+
+public:
+  UINT64 total;
+  double squares;
+
+  SampleCountVisitor( bool documents ) :
+    _documents(documents), _block(0), _blockTotal(0), total(0), squares(0) {}
+
+  bool visit( lemur::api::DOCID_T document, int, const std::vector<WindowExtent>& extents ) {
+    UINT64 block = document / WINDOW_SAMPLE_BLOCK;
+    if( block != _block ) {
+      finish();
+      _block = block;
+    }
+
+    UINT64 count = _documents ? 1 : extents.size();
+    total += count;
+    _blockTotal += count;
+    return true;
+  }
+
+  void finish() {
+    squares += (double) _blockTotal * _blockTotal;
+    _blockTotal = 0;
+  }
+};
+
+void print_approximate_file_count( indri::collection::Repository& r, const std::string& fileName, bool documents,
+                                   double rate, bool stratified, double threshold, double z, int threadCount ) {
+  if( rate <= 0 || rate > 1 )
+    LEMUR_THROW( LEMUR_BAD_PARAMETER_ERROR, "Sample rate must be in (0, 1]" );
+
+  indri::collection::Repository::index_state state = r.indexes();
+  WindowSample sample;
+  sample.rate = rate;
+  sample.stratified = stratified;
+  sample.maxDocument = 0;
+  for( size_t i=0; i<state->size(); i++ )
+    sample.maxDocument = std::max( sample.maxDocument, (*state)[i]->documentMaximum() );
+
+  ifstream file( fileName.c_str() );
+  std::string line;
+  std::vector<std::string> expressions;
+
+  while( std::getline( file, line, '\n' ) )
+    expressions.push_back( line );
+
+  // stemming goes through the repository's shared parser, so parse serially
+  std::vector<WindowExpression*> roots( expressions.size() );
+  for( size_t i=0; i<expressions.size(); i++ )
+    roots[i] = parse_window_expression( r, expressions[i] );
+
+  std::vector<double> estimates( expressions.size() );
+  std::vector<double> lows( expressions.size() );
+  std::vector<double> highs( expressions.size() );
+  std::vector<char> counted( expressions.size(), rate >= 1 );
+
+  run_parallel( expressions.size(), threadCount, [&]( size_t i ) {
+    SampleCountVisitor sampled( documents );
+    walk_cached_window_expression( r, roots[i], sampled, rate < 1 ? &sample : 0 );
+    sampled.finish();
+
+    double estimate = sampled.total / rate;
+    double half = z * sqrt( (1 - rate) / (rate * rate) * sampled.squares );
+    double low = std::max( (double) sampled.total, estimate - half );
+    double high = estimate + half;
+
+    if( threshold >= 0 && low < threshold && threshold < high ) {
+      SampleCountVisitor exact( documents );
+      walk_cached_window_expression( r, roots[i], exact );
+      estimate = low = high = exact.total;
+      counted[i] = true;
+    }
+
+    estimates[i] = estimate;
+    lows[i] = low;
+    highs[i] = high;
+  } );
+
+  for( size_t i=0; i<expressions.size(); i++ ) {
+    std::cout << expressions[i] << ":" << estimates[i] << ":" << lows[i] << ":" << highs[i]
+              << ":" << ( counted[i] ? "counted" : "sampled" ) << std::endl;
+    delete roots[i];
+  }
+}
+
+//
+// Prints the extents of a window expression in the same format as
+// expressionlist (e), but streams them: output is buffered in chunks of
+// EXTENT_CHUNK_LINES lines and memory does not grow with the posting
+// length.  A limit stops the walk after that many results; in
+// per-document mode each result is (document, extent count, length).
+//
+
+#define EXTENT_CHUNK_LINES 4096
+
+class ExtentStreamPrinter : public WindowExtentVisitor {
+private:
+  std::ostringstream _buffer;
+  size_t _lines;
+  UINT64 _results;
+  UINT64 _limit;
+  bool _perDocument;
+
+  void _flush() {
+    std::cout << _buffer.str();
+    _buffer.str( "" );
+    _lines = 0;
+  }
+
+public:
+  ExtentStreamPrinter( UINT64 limit, bool perDocument ) :
+    _lines(0), _results(0), _limit(limit), _perDocument(perDocument) {}
+  ~ExtentStreamPrinter() { _flush(); }
+
+  bool visit( lemur::api::DOCID_T document, int length, const std::vector<WindowExtent>& extents ) {
+    if( _perDocument ) {
+      _buffer << document << " " << extents.size() << " " << length << "\n";
+      _lines++;
+      _results++;
+    } else {
+      for( size_t i=0; i<extents.size() && (_limit == 0 || _results < _limit); i++ ) {
+        _buffer << document << " 1 " << extents[i].begin << " " << extents[i].end << "\n";
+        _lines++;
+        _results++;
+      }
+    }
+
+    if( _lines >= EXTENT_CHUNK_LINES )
+      _flush();
+
+    return _limit == 0 || _results < _limit;
+  }
+};
+
+void print_expression_stream( indri::collection::Repository& r, const std::string& expression, UINT64 limit, bool perDocument ) {
+  indri::server::LocalQueryServer local(r);
+  WindowExpression* root = parse_window_expression( r, expression );
+
+  std::cout << expression << " " << local.termCount() << " "
+            << local.documentCount() << std::endl;
+
+  {
+    ExtentStreamPrinter printer( limit, perDocument );
+    walk_window_expression( r, root, printer );
+  }
+
+  std::cout.flush();
+  delete root;
+}
+
 //
 // Attempts to validate the index.  Right now it only checks
 // TermLists, but may do more in the future.
@@ -377,6 +1482,265 @@ void print_vocabulary( indri::collection::Repository& r ) {
   delete iter;
 }
 
+//
+// Term statistics table.  A flat file with one record per distinct term
+// across all index partitions, sorted by term text, followed by an
+// open-addressed hash table (load factor <= 0.5, linear probing) over
+// those records and the term text itself.  The file is mmap'd read-only
+// so a lookup is one hash, usually one probe, and no iterator.
+//
+// Layout: header | records[termCount] | buckets[bucketCount] | text
+//
+
+#define TERMSTATS_MAGIC   0x53545254
+#define TERMSTATS_VERSION 1
+
+struct TermStatsHeader {
+  UINT64 magic;
+  UINT64 version;
+  UINT64 termCount;
+  UINT64 bucketCount;
+  UINT64 totalTermCount;
+  UINT64 documentCount;
+};
+
+struct TermStatsRecord {
+  UINT64 totalCount;     // cf, summed over partitions
+  UINT64 documentCount;  // df, summed over partitions
+  UINT64 termID;         // index termID; 0 unless the repository has a single partition
+  UINT64 textOffset;
+  UINT64 textLength;
+};
+
+static UINT64 termstats_hash( const char* text, size_t length ) {
+  UINT64 h = 14695981039346656037ULL;
+  for( size_t i=0; i<length; i++ ) {
+    h ^= (unsigned char) text[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+class TermStatsTable {
+private:
+  char* _base;
+  size_t _length;
+  const TermStatsHeader* _header;
+  const TermStatsRecord* _records;
+  const UINT64* _buckets;
+  const char* _text;
+
+public:
+  TermStatsTable() : _base(0), _length(0), _header(0), _records(0), _buckets(0), _text(0) {}
+  ~TermStatsTable() { close(); }
+
+  void open( const std::string& path ) {
+    int fd = ::open( path.c_str(), O_RDONLY );
+    if( fd < 0 )
+      LEMUR_THROW( LEMUR_IO_ERROR, "Couldn't open term statistics table: " + path );
+
+    struct stat st;
+    if( fstat( fd, &st ) != 0 || (size_t) st.st_size < sizeof(TermStatsHeader) ) {
+      ::close( fd );
+      LEMUR_THROW( LEMUR_IO_ERROR, "Term statistics table is truncated: " + path );
+    }
+
+    _length = st.st_size;
+    void* base = mmap( 0, _length, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if( base == MAP_FAILED )
+      LEMUR_THROW( LEMUR_IO_ERROR, "Couldn't map term statistics table: " + path );
+
+    _base = (char*) base;
+    _header = (const TermStatsHeader*) _base;
+    if( _header->magic != TERMSTATS_MAGIC || _header->version != TERMSTATS_VERSION ) {
+      close();
+      LEMUR_THROW( LEMUR_IO_ERROR, "Not a term statistics table: " + path );
+    }
+
+    // every offset below is derived from the header, so check it against
+    // the mapped size before trusting it
+    UINT64 termCount = _header->termCount;
+    UINT64 bucketCount = _header->bucketCount;
+    UINT64 available = _length - sizeof(TermStatsHeader);
+    // lookup probes until an empty bucket, so at least half must be empty
+    bool valid = bucketCount != 0 && (bucketCount & (bucketCount - 1)) == 0 &&
+      bucketCount / 2 >= termCount &&
+      termCount <= available / sizeof(TermStatsRecord);
+    if( valid ) {
+      available -= termCount * sizeof(TermStatsRecord);
+      valid = bucketCount <= available / sizeof(UINT64);
+    }
+    if( !valid ) {
+      close();
+      LEMUR_THROW( LEMUR_IO_ERROR, "Term statistics table is truncated or corrupt: " + path );
+    }
+
+    _records = (const TermStatsRecord*) (_base + sizeof(TermStatsHeader));
+    _buckets = (const UINT64*) (_records + termCount);
+    _text = (const char*) (_buckets + bucketCount);
+    UINT64 textLength = available - bucketCount * sizeof(UINT64);
+
+    for( UINT64 i=0; i<termCount; i++ ) {
+      if( _records[i].textOffset > textLength || _records[i].textLength > textLength - _records[i].textOffset ) {
+        close();
+        LEMUR_THROW( LEMUR_IO_ERROR, "Term statistics table is truncated or corrupt: " + path );
+      }
+    }
+    for( UINT64 i=0; i<bucketCount; i++ ) {
+      if( _buckets[i] > termCount ) {
+        close();
+        LEMUR_THROW( LEMUR_IO_ERROR, "Term statistics table is truncated or corrupt: " + path );
+      }
+    }
+  }
+
+  void close() {
+    if( _base )
+      munmap( _base, _length );
+    _base = 0;
+    _length = 0;
+    _header = 0;
+  }
+
+  const TermStatsHeader* header() const {
+    return _header;
+  }
+
+  const TermStatsRecord* lookup( const std::string& term ) const {
+    UINT64 mask = _header->bucketCount - 1;
+    UINT64 slot = termstats_hash( term.c_str(), term.size() ) & mask;
+
+    for( UINT64 probes = 0; _buckets[slot] && probes < _header->bucketCount; probes++ ) {
+      const TermStatsRecord* record = _records + (_buckets[slot] - 1);
+      if( record->textLength == term.size() &&
+          memcmp( _text + record->textOffset, term.c_str(), term.size() ) == 0 )
+        return record;
+      slot = (slot + 1) & mask;
+    }
+
+    return 0;
+  }
+};
+
+//
+// Builds the term statistics table from the vocabulary of every index
+// partition.  Partition statistics are summed, so a term split across
+// a disk index and a memory index gets its collection-wide cf/df.
+// termIDs are only recorded for single-partition repositories.
+//
+
+void build_term_stats( indri::collection::Repository& r, const std::string& outputPath ) {
+  indri::server::LocalQueryServer local(r);
+  indri::collection::Repository::index_state state = r.indexes();
+  std::map<std::string, TermStatsRecord> terms;
+
+  for( size_t i=0; i<state->size(); i++ ) {
+    indri::index::Index* index = (*state)[i];
+    indri::index::VocabularyIterator* iter = index->vocabularyIterator();
+
+    for( iter->startIteration(); iter->finished() == false; iter->nextEntry() ) {
+      indri::index::DiskTermData* entry = iter->currentEntry();
+      indri::index::TermData* termData = entry->termData;
+
+      std::map<std::string, TermStatsRecord>::iterator found = terms.find( termData->term );
+      if( found == terms.end() ) {
+        TermStatsRecord record;
+        record.totalCount = termData->corpus.totalCount;
+        record.documentCount = termData->corpus.documentCount;
+        // termIDs are per partition, so they only identify a term when there is one
+        record.termID = ( state->size() == 1 ) ? entry->termID : 0;
+        record.textOffset = 0;
+        record.textLength = 0;
+        terms[termData->term] = record;
+      } else {
+        found->second.totalCount += termData->corpus.totalCount;
+        found->second.documentCount += termData->corpus.documentCount;
+      }
+    }
+
+    delete iter;
+  }
+
+  TermStatsHeader header;
+  header.magic = TERMSTATS_MAGIC;
+  header.version = TERMSTATS_VERSION;
+  header.termCount = terms.size();
+  header.bucketCount = 1;
+  while( header.bucketCount < 2 * header.termCount )
+    header.bucketCount <<= 1;
+  header.totalTermCount = local.termCount();
+  header.documentCount = local.documentCount();
+
+  std::vector<TermStatsRecord> records;
+  std::vector<UINT64> buckets( header.bucketCount, 0 );
+  std::string text;
+  records.reserve( terms.size() );
+
+  for( std::map<std::string, TermStatsRecord>::iterator iter = terms.begin(); iter != terms.end(); iter++ ) {
+    TermStatsRecord record = iter->second;
+    record.textOffset = text.size();
+    record.textLength = iter->first.size();
+    text += iter->first;
+
+    UINT64 slot = termstats_hash( iter->first.c_str(), iter->first.size() ) & (header.bucketCount - 1);
+    while( buckets[slot] )
+      slot = (slot + 1) & (header.bucketCount - 1);
+    records.push_back( record );
+    buckets[slot] = records.size();
+  }
+
+  std::ofstream out( outputPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+  if( !out )
+    LEMUR_THROW( LEMUR_IO_ERROR, "Couldn't create term statistics table: " + outputPath );
+
+  out.write( (const char*) &header, sizeof header );
+  if( records.size() )
+    out.write( (const char*) &records[0], records.size() * sizeof(TermStatsRecord) );
+  out.write( (const char*) &buckets[0], buckets.size() * sizeof(UINT64) );
+  out.write( text.c_str(), text.size() );
+  out.close();
+
+  if( !out )
+    LEMUR_THROW( LEMUR_IO_ERROR, "Couldn't write term statistics table: " + outputPath );
+
+  std::cout << outputPath << " " << header.termCount << " "
+            << header.totalTermCount << " " << header.documentCount << std::endl;
+}
+
+//
+// Batch lookup against a term statistics table.  Each line of the input
+// file is a term; it is stemmed by the repository and printed as
+// (term, stem, cf, df, termID).  Unknown terms print zeros.
+//
+
+void print_term_stats( indri::collection::Repository& r, const std::string& tablePath, const std::string& termFile ) {
+  TermStatsTable table;
+  table.open( tablePath );
+
+  std::cout << "TOTAL" << " " << table.header()->totalTermCount << " "
+            << table.header()->documentCount << std::endl;
+
+  std::ifstream file( termFile.c_str() );
+  std::string line;
+
+  while( std::getline( file, line, '\n' ) ) {
+    std::string stem = r.processTerm( line );
+    const TermStatsRecord* record = stem.size() ? table.lookup( stem ) : 0;
+
+    std::cout << line << " " << stem << " ";
+    if( record ) {
+      std::cout << record->totalCount << " "
+                << record->documentCount << " "
+                << record->termID << std::endl;
+    } else {
+      std::cout << "0 0 0" << std::endl;
+    }
+  }
+
+  table.close();
+}
+
 void print_field_positions( indri::collection::Repository& r, const std::string& fieldString ) {
   indri::server::LocalQueryServer local(r);
 
@@ -513,12 +1877,16 @@ void print_document_name( indri::collection::Repository& r, const char* number )
   std::cout << documentName << std::endl;
 }
 
+void write_document_text( std::ostream& out, indri::api::ParsedDocument* document ) {
+  out << document->text << std::endl;
+}
+
 void print_document_text( indri::collection::Repository& r, const char* number ) {
   int documentID = atoi( number );
   indri::collection::CompressedCollection* collection = r.collection();
   indri::api::ParsedDocument* document = collection->retrieve( documentID );
 
-  std::cout << document->text << std::endl;
+  write_document_text( std::cout, document );
   delete document;
 }
 
@@ -548,47 +1916,50 @@ void print_document_map( indri::collection::Repository& r ) {
 	}
 }
 
-void print_document_data( indri::collection::Repository& r, const char* number ) {
-  int documentID = atoi( number );
-  indri::collection::CompressedCollection* collection = r.collection();
-  indri::api::ParsedDocument* document = collection->retrieve( documentID );
-
-  std::cout << std::endl << "--- Metadata ---" << std::endl << std::endl;
+void write_document_data( std::ostream& out, indri::api::ParsedDocument* document ) {
+  out << std::endl << "--- Metadata ---" << std::endl << std::endl;
 
   for( size_t i=0; i<document->metadata.size(); i++ ) {
     if( document->metadata[i].key[0] == '#' )
       continue;
 
-    std::cout << document->metadata[i].key << ": "
-              << (const char*) document->metadata[i].value
-              << std::endl;
+    out << document->metadata[i].key << ": "
+        << (const char*) document->metadata[i].value
+        << std::endl;
   }
 
-  std::cout << std::endl << "--- Positions ---" << std::endl << std::endl;
+  out << std::endl << "--- Positions ---" << std::endl << std::endl;
 
   for( size_t i=0; i<document->positions.size(); i++ ) {
-    std::cout << i << " "
-              << document->positions[i].begin << " "
-              << document->positions[i].end << std::endl;
+    out << i << " "
+        << document->positions[i].begin << " "
+        << document->positions[i].end << std::endl;
 
   }
 
-  std::cout << std::endl << "--- Tags ---" << std::endl << std::endl;
+  out << std::endl << "--- Tags ---" << std::endl << std::endl;
 
   for( size_t i=0; i<document->tags.size(); i++ ) {
-    std::cout << i << " "
-              << document->tags[i]->name << " " 
-              << document->tags[i]->begin << " "
-              << document->tags[i]->end << " " 
-              << document->tags[i]->number << std::endl;
+    out << i << " "
+        << document->tags[i]->name << " " 
+        << document->tags[i]->begin << " "
+        << document->tags[i]->end << " " 
+        << document->tags[i]->number << std::endl;
   }
 
-  std::cout << std::endl << "--- Text ---" << std::endl << std::endl;
-  std::cout << document->text << std::endl;
+  out << std::endl << "--- Text ---" << std::endl << std::endl;
+  out << document->text << std::endl;
 
-  std::cout << std::endl << "--- Content ---" << std::endl << std::endl;
-  std::cout << document->getContent() << std::endl;
+  out << std::endl << "--- Content ---" << std::endl << std::endl;
+  out << document->getContent() << std::endl;
+}
+
+void print_document_data( indri::collection::Repository& r, const char* number ) {
+  int documentID = atoi( number );
+  indri::collection::CompressedCollection* collection = r.collection();
+  indri::api::ParsedDocument* document = collection->retrieve( documentID );
 
+  write_document_data( std::cout, document );
   delete document;
 }
 
@@ -628,6 +1999,24 @@ void print_document_csv( indri::collection::Repository& r ) {
   }
 }
 
+void write_document_vector( std::ostream& out, indri::api::DocumentVector* docVector ) {
+  out << "--- Fields ---" << std::endl;
+
+  for( size_t i=0; i<docVector->fields().size(); i++ ) {
+    const indri::api::DocumentVector::Field& field = docVector->fields()[i];
+    out << field.name << " " << field.begin << " " << field.end << " " << field.number << std::endl;
+  }
+
+  out << "--- Terms ---" << std::endl;
+
+  for( size_t i=0; i<docVector->positions().size(); i++ ) {
+    int position = docVector->positions()[i];
+    const std::string& stem = docVector->stems()[position];
+
+    out << i << " " << position << " " << stem << std::endl;
+  }
+}
+
 void print_document_vector( indri::collection::Repository& r, const char* number ) {
   indri::server::LocalQueryServer local(r);
   lemur::api::DOCID_T documentID = atoi( number );
@@ -639,27 +2028,457 @@ void print_document_vector( indri::collection::Repository& r, const char* number
   
   if( response->getResults().size() ) {
     indri::api::DocumentVector* docVector = response->getResults()[0];
-  
-    std::cout << "--- Fields ---" << std::endl;
+    write_document_vector( std::cout, docVector );
+    delete docVector;
+  }
+
+  delete response;
+}
+
+//
+// Batch document retrieval.  Each line of the file is an internal
+// document ID.  Requests are handled in windows of DOCUMENT_BATCH_SIZE
+// lines: the distinct IDs of a window are sorted so the compressed
+// collection (or the term lists, for vectors) is read in storage order,
+// documents are retrieved and formatted on a pool of threads, and the
+// output is written back in request order, one block per line.
+//
+
+#define DOCUMENT_BATCH_SIZE 1024
 
-    for( size_t i=0; i<docVector->fields().size(); i++ ) {
-      const indri::api::DocumentVector::Field& field = docVector->fields()[i];
-      std::cout << field.name << " " << field.begin << " " << field.end << " " << field.number << std::endl;
+void print_document_file( indri::collection::Repository& r, const std::string& kind, const std::string& fileName, int threadCount ) {
+  indri::server::LocalQueryServer local(r);
+  indri::collection::CompressedCollection* collection = r.collection();
+
+  ifstream file( fileName.c_str() );
+  std::string line;
+  bool done = false;
+
+  while( !done ) {
+    std::vector<lemur::api::DOCID_T> requests;
+    while( requests.size() < DOCUMENT_BATCH_SIZE && !(done = !std::getline( file, line, '\n' )) ) {
+      boost::trim( line );
+      if( line.size() )
+        requests.push_back( atoi( line.c_str() ) );
     }
+    if( requests.empty() )
+      break;
+
+    std::vector<lemur::api::DOCID_T> documentIDs( requests.begin(), requests.end() );
+    std::sort( documentIDs.begin(), documentIDs.end() );
+    documentIDs.erase( std::unique( documentIDs.begin(), documentIDs.end() ), documentIDs.end() );
+    std::vector<std::string> output( documentIDs.size() );
+
+    if( kind == "dv" ) {
+      indri::server::QueryServerVectorsResponse* response = local.documentVectors( documentIDs );
+      std::vector<indri::api::DocumentVector*>& vectors = response->getResults();
+
+      if( vectors.size() != documentIDs.size() ) {
+        for( size_t i=0; i<vectors.size(); i++ )
+          delete vectors[i];
+        delete response;
+        LEMUR_THROW( LEMUR_RUNTIME_ERROR, "documentVectors returned a different number of vectors than requested" );
+      }
 
-    std::cout << "--- Terms ---" << std::endl;
+      run_parallel( vectors.size(), threadCount, [&]( size_t i ) {
+        std::ostringstream out;
+        write_document_vector( out, vectors[i] );
+        output[i] = out.str();
+        delete vectors[i];
+      } );
 
-    for( size_t i=0; i<docVector->positions().size(); i++ ) {
-      int position = docVector->positions()[i];
-      const std::string& stem = docVector->stems()[position];
+      delete response;
+    } else {
+      run_parallel( documentIDs.size(), threadCount, [&]( size_t i ) {
+        std::ostringstream out;
+
+        if( kind == "dn" ) {
+          out << collection->retrieveMetadatum( documentIDs[i], "docno" ) << std::endl;
+        } else {
+          indri::api::ParsedDocument* document = collection->retrieve( documentIDs[i] );
+          if( kind == "dd" )
+            write_document_data( out, document );
+          else
+            write_document_text( out, document );
+          delete document;
+        }
 
-      std::cout << i << " " << position << " " << stem << std::endl;
+        output[i] = out.str();
+      } );
     }
 
-    delete docVector;
+    for( size_t i=0; i<requests.size(); i++ ) {
+      size_t slot = std::lower_bound( documentIDs.begin(), documentIDs.end(), requests[i] ) - documentIDs.begin();
+
+      if( kind == "dn" ) {
+        std::cout << requests[i] << " " << output[slot];
+      } else {
+        std::cout << "--- Document " << requests[i] << " ---" << std::endl;
+        std::cout << output[slot];
+      }
+    }
   }
+}
+
+//
+// Relevance model (RM3) expansion terms.  Each line of the query file is
+//
+//   queryID:query text:docno[=score],docno[=score],...
+//
+// where the documents are that query's top feedback documents and the
+// optional score is its log retrieval score (uniform if absent).  All
+// feedback document vectors are fetched up front with batched
+// documentVectors calls, then the queries are scored on a pool of
+// threads.  As in Indri's own RM3 feedback, the relevance model covers
+// every stem of the query's feedback documents, each document model is
+// Dirichlet smoothed (fbMu) against the collection frequency of each
+// stem, so a document also contributes to stems it does not contain,
+// and the top fbTerms terms are interpolated with the original query by
+// fbOrigWeight.
+//
+
+#define FEEDBACK_VECTOR_BATCH 256
+
+// documentVectors results are matched to the request by position, so a
+// short or long response would attach vectors to the wrong documents
+static void check_vector_response( indri::server::QueryServerVectorsResponse* response, size_t requested ) {
+  if( response->getResults().size() == requested )
+    return;
 
+  for( size_t i=0; i<response->getResults().size(); i++ )
+    delete response->getResults()[i];
   delete response;
+  LEMUR_THROW( LEMUR_RUNTIME_ERROR, "documentVectors returned a different number of vectors than requested" );
+}
+
+struct FeedbackDocument {
+  int length;
+  std::vector< std::pair<int, int> > stems;  // (stem id, tf)
+};
+
+struct FeedbackQuery {
+  std::string id;
+  std::vector<int> stems;
+  std::vector<lemur::api::DOCID_T> documents;
+  std::vector<double> scores;
+  std::vector< std::pair<double, int> > terms;  // (weight, stem id)
+};
+
+struct FeedbackModel {
+  std::vector<std::string> stems;
+  std::vector<double> collectionProbability;
+  std::map<lemur::api::DOCID_T, FeedbackDocument> documents;
+  int fbTerms;
+  double fbMu;
+  double fbOrigWeight;
+};
+
+static int feedback_stem_id( std::map<std::string, int>& ids, std::vector<std::string>& stems, const std::string& stem ) {
+  std::map<std::string, int>::iterator found = ids.find( stem );
+  if( found != ids.end() )
+    return found->second;
+
+  ids[stem] = stems.size();
+  stems.push_back( stem );
+  return stems.size() - 1;
+}
+
+static void score_feedback_query( const FeedbackModel& model, FeedbackQuery& query ) {
+  std::map<int, double> relevance;
+  double maxScore = 0;
+  double norm = 0;
+  double smoothing = 0;
+
+  for( size_t i=0; i<query.scores.size(); i++ )
+    if( i == 0 || query.scores[i] > maxScore )
+      maxScore = query.scores[i];
+
+  for( size_t i=0; i<query.documents.size(); i++ ) {
+    std::map<lemur::api::DOCID_T, FeedbackDocument>::const_iterator found = model.documents.find( query.documents[i] );
+    if( found == model.documents.end() )
+      continue;
+
+    const FeedbackDocument& document = found->second;
+    double weight = exp( query.scores[i] - maxScore );
+    double denominator = document.length + model.fbMu;
+    if( denominator <= 0 )
+      continue;
+    norm += weight;
+
+    // fbMu * P(w|C) / (|D| + fbMu) goes to every stem, present or not;
+    // it is added below once the feedback vocabulary is known
+    smoothing += weight * model.fbMu / denominator;
+    for( size_t j=0; j<document.stems.size(); j++ )
+      relevance[document.stems[j].first] += weight * document.stems[j].second / denominator;
+  }
+
+  for( std::map<int, double>::iterator iter = relevance.begin(); iter != relevance.end(); iter++ )
+    iter->second += smoothing * model.collectionProbability[iter->first];
+
+  std::vector< std::pair<double, int> > ranked;
+  for( std::map<int, double>::iterator iter = relevance.begin(); iter != relevance.end(); iter++ )
+    ranked.push_back( std::make_pair( iter->second / norm, iter->first ) );
+  std::sort( ranked.rbegin(), ranked.rend() );
+  if( ranked.size() > (size_t) model.fbTerms )
+    ranked.resize( model.fbTerms );
+
+  double rmTotal = 0;
+  for( size_t i=0; i<ranked.size(); i++ )
+    rmTotal += ranked[i].first;
+
+  std::map<int, double> combined;
+  for( size_t i=0; i<ranked.size(); i++ )
+    combined[ranked[i].second] += (1 - model.fbOrigWeight) * ranked[i].first / rmTotal;
+  for( size_t i=0; i<query.stems.size(); i++ )
+    combined[query.stems[i]] += model.fbOrigWeight / query.stems.size();
+
+  query.terms.clear();
+  for( std::map<int, double>::iterator iter = combined.begin(); iter != combined.end(); iter++ )
+    query.terms.push_back( std::make_pair( iter->second, iter->first ) );
+  std::sort( query.terms.rbegin(), query.terms.rend() );
+}
+
+void print_feedback_terms( indri::collection::Repository& r, const std::string& queryFile,
+                           int fbTerms, double fbMu, double fbOrigWeight, int threadCount ) {
+  indri::server::LocalQueryServer local(r);
+  indri::collection::CompressedCollection* collection = r.collection();
+
+  FeedbackModel model;
+  model.fbTerms = fbTerms;
+  model.fbMu = fbMu;
+  model.fbOrigWeight = fbOrigWeight;
+
+  std::map<std::string, int> stemIDs;
+  std::vector<FeedbackQuery> queries;
+  std::set<lemur::api::DOCID_T> documentIDs;
+
+  ifstream file( queryFile.c_str() );
+  std::string line;
+
+  while( std::getline( file, line, '\n' ) ) {
+    std::vector<std::string> strs;
+    boost::split( strs, line, boost::is_any_of( ":" ) );
+    if( strs.size() < 3 )
+      continue;
+
+    FeedbackQuery query;
+    query.id = strs[0];
+
+    std::vector<std::string> words;
+    boost::split( words, strs[1], boost::is_any_of( " " ), boost::token_compress_on );
+    for( size_t i=0; i<words.size(); i++ ) {
+      std::string stem = r.processTerm( words[i] );
+      if( stem.size() )
+        query.stems.push_back( feedback_stem_id( stemIDs, model.stems, stem ) );
+    }
+
+    std::vector<std::string> topDocs;
+    boost::split( topDocs, strs[2], boost::is_any_of( "," ) );
+    for( size_t i=0; i<topDocs.size(); i++ ) {
+      std::string docno = topDocs[i];
+      double score = 0;
+      size_t equals = docno.find( '=' );
+      if( equals != std::string::npos ) {
+        score = atof( docno.c_str() + equals + 1 );
+        docno = docno.substr( 0, equals );
+      }
+      boost::trim( docno );
+      if( docno.empty() )
+        continue;
+
+      std::vector<lemur::api::DOCID_T> ids = collection->retrieveIDByMetadatum( "docno", docno );
+      if( ids.empty() )
+        continue;
+
+      query.documents.push_back( ids[0] );
+      query.scores.push_back( score );
+      documentIDs.insert( ids[0] );
+    }
+
+    queries.push_back( query );
+  }
+
+  // fetch every feedback document once, in batches
+  std::vector<lemur::api::DOCID_T> pending( documentIDs.begin(), documentIDs.end() );
+
+  for( size_t start=0; start<pending.size(); start += FEEDBACK_VECTOR_BATCH ) {
+    size_t end = std::min( pending.size(), start + FEEDBACK_VECTOR_BATCH );
+    std::vector<lemur::api::DOCID_T> batch( pending.begin() + start, pending.begin() + end );
+    indri::server::QueryServerVectorsResponse* response = local.documentVectors( batch );
+    check_vector_response( response, batch.size() );
+
+    for( size_t i=0; i<response->getResults().size(); i++ ) {
+      indri::api::DocumentVector* docVector = response->getResults()[i];
+      std::map<int, int> counts;
+
+      for( size_t j=0; j<docVector->positions().size(); j++ ) {
+        const std::string& stem = docVector->stems()[docVector->positions()[j]];
+        if( stem != "[OOV]" )
+          counts[feedback_stem_id( stemIDs, model.stems, stem )]++;
+      }
+
+      FeedbackDocument& document = model.documents[batch[i]];
+      document.length = docVector->positions().size();
+      document.stems.assign( counts.begin(), counts.end() );
+
+      delete docVector;
+    }
+
+    delete response;
+  }
+
+  // collection language model for smoothing
+  double totalCount = (double) local.termCount();
+  model.collectionProbability.resize( model.stems.size(), 0 );
+  if( fbMu > 0 && totalCount > 0 ) {
+    for( size_t i=0; i<model.stems.size(); i++ )
+      model.collectionProbability[i] = local.stemCount( model.stems[i] ) / totalCount;
+  }
+
+  run_parallel( queries.size(), threadCount, [&]( size_t i ) {
+    score_feedback_query( model, queries[i] );
+  } );
+
+  for( size_t i=0; i<queries.size(); i++ ) {
+    for( size_t j=0; j<queries[i].terms.size(); j++ ) {
+      std::cout << queries[i].id << " "
+                << model.stems[queries[i].terms[j].second] << " "
+                << queries[i].terms[j].first << std::endl;
+    }
+  }
+}
+
+//
+// Counts window expressions within each query's top documents only.
+// Each line of the file is expression:docno,docno,... as for
+// expressionfilenameBrief (efb); lines sharing the same document list
+// belong to one query.  Instead of evaluating the expression over the
+// whole collection, the top documents' vectors are loaded once into a
+// small positional forward index (stem -> positions per document), and
+// every expression of the query is evaluated against it, queries in
+// parallel.  Output, in file order:
+//
+//   expression:occurrences:documents:docno,docno,...
+//
+// listing the top documents that contain the expression.
+//
+
+struct ForwardDocument {
+  std::string name;
+  WindowPositions positions;
+};
+
+void print_topdoc_file_count( indri::collection::Repository& r, const std::string& fileName, int threadCount ) {
+  indri::server::LocalQueryServer local(r);
+  indri::collection::CompressedCollection* collection = r.collection();
+
+  ifstream file( fileName.c_str() );
+  std::string line;
+
+  std::vector<std::string> expressions;
+  std::vector<WindowExpression*> roots;
+  std::map<std::string, lemur::api::DOCID_T> docnoIDs;
+  std::map<std::set<lemur::api::DOCID_T>, size_t> queryIndex;
+  std::vector< std::vector<lemur::api::DOCID_T> > queryDocuments;
+  std::vector< std::vector<size_t> > queryExpressions;
+  std::map<lemur::api::DOCID_T, ForwardDocument> forward;
+
+  while( std::getline( file, line, '\n' ) ) {
+    size_t colon = line.rfind( ':' );
+    if( colon == std::string::npos )
+      continue;
+
+    // a query is its set of top documents, whatever the order or spacing
+    std::string topDocs = line.substr( colon + 1 );
+    std::vector<std::string> docnos;
+    boost::split( docnos, topDocs, boost::is_any_of( "," ) );
+    std::set<lemur::api::DOCID_T> documents;
+
+    for( size_t i=0; i<docnos.size(); i++ ) {
+      boost::trim( docnos[i] );
+      if( docnos[i].empty() )
+        continue;
+
+      std::map<std::string, lemur::api::DOCID_T>::iterator known = docnoIDs.find( docnos[i] );
+      if( known == docnoIDs.end() ) {
+        std::vector<lemur::api::DOCID_T> ids = collection->retrieveIDByMetadatum( "docno", docnos[i] );
+        known = docnoIDs.insert( std::make_pair( docnos[i], ids.empty() ? 0 : ids[0] ) ).first;
+        if( ids.size() )
+          forward[ids[0]].name = docnos[i];
+      }
+      if( known->second )
+        documents.insert( known->second );
+    }
+
+    std::map<std::set<lemur::api::DOCID_T>, size_t>::iterator found = queryIndex.find( documents );
+    if( found == queryIndex.end() ) {
+      found = queryIndex.insert( std::make_pair( documents, queryDocuments.size() ) ).first;
+      queryDocuments.push_back( std::vector<lemur::api::DOCID_T>( documents.begin(), documents.end() ) );
+      queryExpressions.push_back( std::vector<size_t>() );
+    }
+
+    queryExpressions[found->second].push_back( expressions.size() );
+    expressions.push_back( line.substr( 0, colon ) );
+    roots.push_back( parse_window_expression( r, expressions.back() ) );
+  }
+
+  // build the forward index of every top document once
+  std::vector<lemur::api::DOCID_T> pending;
+  for( std::map<lemur::api::DOCID_T, ForwardDocument>::iterator iter = forward.begin(); iter != forward.end(); iter++ )
+    pending.push_back( iter->first );
+
+  for( size_t start=0; start<pending.size(); start += FEEDBACK_VECTOR_BATCH ) {
+    size_t end = std::min( pending.size(), start + FEEDBACK_VECTOR_BATCH );
+    std::vector<lemur::api::DOCID_T> batch( pending.begin() + start, pending.begin() + end );
+    indri::server::QueryServerVectorsResponse* response = local.documentVectors( batch );
+    check_vector_response( response, batch.size() );
+
+    for( size_t i=0; i<response->getResults().size(); i++ ) {
+      indri::api::DocumentVector* docVector = response->getResults()[i];
+      WindowPositions& positions = forward[batch[i]].positions;
+
+      for( size_t j=0; j<docVector->positions().size(); j++ ) {
+        const std::string& stem = docVector->stems()[docVector->positions()[j]];
+        if( stem != "[OOV]" )
+          positions[stem].push_back( j );
+      }
+
+      delete docVector;
+    }
+
+    delete response;
+  }
+
+  std::vector<UINT64> occurrences( expressions.size(), 0 );
+  std::vector<UINT64> matchCounts( expressions.size(), 0 );
+  std::vector<std::string> matches( expressions.size() );
+
+  run_parallel( queryDocuments.size(), threadCount, [&]( size_t q ) {
+    std::vector<WindowExtent> extents;
+
+    for( size_t e=0; e<queryExpressions[q].size(); e++ ) {
+      size_t index = queryExpressions[q][e];
+
+      for( size_t d=0; d<queryDocuments[q].size(); d++ ) {
+        const ForwardDocument& document = forward.find( queryDocuments[q][d] )->second;
+        evaluate_window_expression( roots[index], document.positions, extents );
+
+        if( extents.size() ) {
+          occurrences[index] += extents.size();
+          matchCounts[index]++;
+          matches[index] += document.name + ",";
+        }
+      }
+    }
+  } );
+
+  for( size_t i=0; i<expressions.size(); i++ ) {
+    std::cout << expressions[i] << ":"
+              << occurrences[i] << ":"
+              << matchCounts[i] << ":"
+              << matches[i] << std::endl;
+    delete roots[i];
+  }
 }
 
 void print_document_id( indri::collection::Repository& r, const char* an, const char* av ) {
@@ -722,6 +2541,93 @@ void delete_document( const std::string& repositoryPath, const char* stringDocum
   r.close();
 }
 
+//
+// Deletes every document listed in a file under a single open of the
+// repository.  mode says how each line is resolved: "id" for internal
+// document IDs, "docno" for docnos, or "field" for metadata "field value"
+// pairs resolved the same way as documentid (di).  Lines that resolve to
+// no document are reported and skipped.  With compact set, the
+// repository is compacted before it is closed.
+//
+
+void delete_document_file( const std::string& repositoryPath, const std::string& fileName, const std::string& mode, bool compact ) {
+  if( mode != "id" && mode != "docno" && mode != "field" )
+    LEMUR_THROW( LEMUR_BAD_PARAMETER_ERROR, "Delete mode must be id, docno or field: " + mode );
+
+  ifstream file( fileName.c_str() );
+  if( !file )
+    LEMUR_THROW( LEMUR_IO_ERROR, "Couldn't open document list: " + fileName );
+
+  indri::collection::Repository r;
+  r.open( repositoryPath );
+  indri::collection::CompressedCollection* collection = r.collection();
+
+  lemur::api::DOCID_T maxDocument = 0;
+  indri::collection::Repository::index_state state = r.indexes();
+  for( size_t i=0; i<state->size(); i++ )
+    maxDocument = std::max( maxDocument, (*state)[i]->documentMaximum() );
+
+  std::string line;
+  std::set<lemur::api::DOCID_T> documentIDs;
+  size_t unresolved = 0;
+
+  while( std::getline( file, line, '\n' ) ) {
+    boost::trim( line );
+    if( line.empty() )
+      continue;
+
+    std::vector<lemur::api::DOCID_T> ids;
+
+    if( mode == "id" ) {
+      if( line.find_first_not_of( "0123456789" ) == std::string::npos ) {
+        lemur::api::DOCID_T documentID = (lemur::api::DOCID_T) string_to_i64( line );
+        if( documentID > 0 && documentID <= maxDocument )
+          ids.push_back( documentID );
+      }
+    } else if( mode == "docno" ) {
+      ids = collection->retrieveIDByMetadatum( "docno", line );
+    } else {
+      std::vector<std::string> strs;
+      boost::split( strs, line, boost::is_any_of( " \t" ), boost::token_compress_on );
+      if( strs.size() == 2 )
+        ids = collection->retrieveIDByMetadatum( strs[0], strs[1] );
+    }
+
+    if( ids.empty() ) {
+      std::cerr << "no document for: " << line << std::endl;
+      unresolved++;
+    }
+    documentIDs.insert( ids.begin(), ids.end() );
+  }
+
+  indri::utility::IndriTimer timer;
+  timer.start();
+
+  size_t deleted = 0;
+  for( std::set<lemur::api::DOCID_T>::iterator iter = documentIDs.begin(); iter != documentIDs.end(); iter++ ) {
+    r.deleteDocument( *iter );
+    deleted++;
+
+    if( deleted % 10000 == 0 ) {
+      std::cerr << "deleted " << deleted << " of " << documentIDs.size() << " documents" << std::endl;
+    }
+  }
+
+  double seconds = timer.elapsedTime() / 1000000.0;
+  std::cout << "deleted " << deleted << " documents in " << seconds << "s";
+  if( seconds > 0 )
+    std::cout << " (" << (deleted / seconds) << " docs/s)";
+  std::cout << ", " << unresolved << " lines unresolved" << std::endl;
+
+  if( compact ) {
+    timer.start();
+    r.compact();
+    std::cout << "compacted in " << (timer.elapsedTime() / 1000000.0) << "s" << std::endl;
+  }
+
+  r.close();
+}
+
 void usage() {
   std::cout << "dumpindex <repository> <command> [ <argument> ]*" << std::endl;
   std::cout << "These commands retrieve data from the repository: " << std::endl;
@@ -731,8 +2637,16 @@ void usage() {
   std::cout << "    fieldpositions (fp)  Field name     Print inverted list for a field, with positions" << std::endl;
   std::cout << "    expressionlist (e)   Expression     Print inverted list for an Indri expression, with positions" << std::endl;
   std::cout << "    expressionfilelist (ef) filename    Print inverted list for a file of Indri expressions" << std::endl;
+  std::cout << "    expressionstream (es) Expression [limit [doc]]  Stream the inverted list of an #od/#uw expression in constant memory, optionally capped or counted per document" << std::endl;
   std::cout << "    xcount (x)           Expression     Print count of occurrences of an Indri expression" << std::endl;
   std::cout << "    fxcount (fx)         filename       Print count of occurrences of all Indri expression in a file" << std::endl;
+  std::cout << "    windowfxcount (wfx)  filename [threads]  Count occurrences of #od/#uw expressions with the built-in window evaluator (not Indri's), in parallel over the posting cache" << std::endl;
+  std::cout << "    windowdxcount (wdx)  filename [threads]  Like wfx, but counting matching documents" << std::endl;
+  std::cout << "    windowcheck (wc)     filename       Compare wfx/wdx counts with Indri's fx/dx counts for a file of #od/#uw expressions, flagging mismatches" << std::endl;
+  std::cout << "    approxfxcount (afx)  filename rate [threshold [z [uniform|stratified [threads]]]]  Estimate window evaluator counts of #od/#uw expressions from a sample of documents, with confidence intervals" << std::endl;
+  std::cout << "    approxdxcount (adx)  filename rate [threshold [z [uniform|stratified [threads]]]]  Like afx, but estimating document counts" << std::endl;
+  std::cout << "    windowtable (wt)     filename maxWindow [threads]  Print #odN/#uwN counts of term tuples for every N up to maxWindow in one pass" << std::endl;
+  std::cout << "    topdoccount (tdx)    filename [threads]  Count expression:docno,... lines within the listed top documents only" << std::endl;
   std::cout << "    dxcount (dx)         Expression     Print document count of occurrences of an Indri expression" << std::endl;
   std::cout << "    documentid (di)      Field, Value   Print the document IDs of documents having a metadata field matching this value" << std::endl;
   std::cout << "    documentname (dn)    Document ID    Print the text representation of a document ID" << std::endl;
@@ -740,15 +2654,24 @@ void usage() {
   std::cout << "    documentdata (dd)    Document ID    Print the full representation of a document" << std::endl;
   std::cout << "    documentmap (dm)     None           Print the full document IDs and names" << std::endl;
   std::cout << "    documentvector (dv)  Document ID    Print the document vector of a document" << std::endl;
+  std::cout << "    documentnamefile (dnf)   File [threads]  Print dn for every document ID in a file" << std::endl;
+  std::cout << "    documenttextfile (dtf)   File [threads]  Print dt for every document ID in a file" << std::endl;
+  std::cout << "    documentdatafile (ddf)   File [threads]  Print dd for every document ID in a file" << std::endl;
+  std::cout << "    documentvectorfile (dvf) File [threads]  Print dv for every document ID in a file" << std::endl;
   std::cout << "    documentCsv (dcsv)   None           Print all the documents in csv format" << std::endl;
+  std::cout << "    relevancemodel (rm)  Query file [fbTerms [fbMu [fbOrigWeight [threads]]]]  Print RM3 expansion terms for queries and their top documents" << std::endl;
   std::cout << "    documentcountfile (dcf) file name   Print the document length of all documents" << std::endl;
   std::cout << "    invlist (il)         None           Print the contents of all inverted lists" << std::endl;
   std::cout << "    vocabulary (v)       None           Print the vocabulary of the index" << std::endl;
+  std::cout << "    termstatsbuild (tsb) Output file    Write a memory-mappable term statistics table for all partitions" << std::endl;
+  std::cout << "    termstats (ts)       Table, file    Print cf, df and termID of every term in a file using a term statistics table" << std::endl;
   std::cout << "    stats (s)                           Print statistics for the Repository" << std::endl;
   std::cout << "These commands change the data inside the repository:" << std::endl;
   std::cout << "    compact (c)          None           Compact the repository, releasing space used by deleted documents." << std::endl;
   std::cout << "    delete (del)         Document ID    Delete the specified document from the repository." << std::endl;
+  std::cout << "    deletefile (delf)    File id|docno|field [compact]  Delete every document listed in a file (internal IDs, docnos or field value pairs), optionally compacting afterwards." << std::endl;
   std::cout << "    merge (m)            Input indexes  Merges a list of Indri repositories together into one repository." << std::endl;
+  std::cout << "Inverted lists read by wfx, wdx, wt, wc, afx and adx are cached in memory; cached lists are kept under $POSTING_CACHE_MB megabytes (default 1024), and a list larger than that is streamed from the index instead." << std::endl;
 }
 
 #define REQUIRE_ARGS(n) { if( argc < n ) { usage(); return -1; } }
@@ -767,6 +2690,10 @@ int main( int argc, char** argv ) {
     } else if( command == "del" || command == "delete" ) {
       REQUIRE_ARGS(4);
       delete_document( repName, argv[3] );
+    } else if( command == "delf" || command == "deletefile" ) {
+      REQUIRE_ARGS(5);
+      bool compact = ( argc > 5 && std::string( argv[5] ) == "compact" );
+      delete_document_file( repName, argv[3], argv[4], compact );
     } else if( command == "m" || command == "merge" ) {
       REQUIRE_ARGS(4);
       merge_repositories( repName, argc, argv );
@@ -797,10 +2724,51 @@ int main( int argc, char** argv ) {
         REQUIRE_ARGS(4);
         std::string expression = argv[3];
         print_expression_list( repName, expression );
+      } else if( command == "es" || command == "expressionstream" ) {
+        REQUIRE_ARGS(4);
+        std::string expression = argv[3];
+        UINT64 limit = ( argc > 4 ) ? string_to_i64( argv[4] ) : 0;
+        bool perDocument = ( argc > 5 && std::string( argv[5] ) == "doc" );
+        print_expression_stream( r, expression, limit, perDocument );
       } else if( command == "fx" || command == "fxcount" ) {
         REQUIRE_ARGS(4);
         std::string expression = argv[3];
         print_file_count( repName, expression );
+      } else if( command == "wfx" || command == "windowfxcount" ||
+                 command == "wdx" || command == "windowdxcount" ) {
+        REQUIRE_ARGS(4);
+        bool documents = ( command == "wdx" || command == "windowdxcount" );
+        int threads = ( argc > 4 ) ? atoi( argv[4] ) : 8;
+        print_window_file_count( r, argv[3], documents, threads );
+      } else if( command == "wc" || command == "windowcheck" ) {
+        REQUIRE_ARGS(4);
+        int mismatches = print_window_check( repName, r, argv[3] );
+        r.close();
+        return mismatches ? 1 : 0;
+      } else if( command == "afx" || command == "approxfxcount" ||
+                 command == "adx" || command == "approxdxcount" ) {
+        REQUIRE_ARGS(5);
+        bool documents = ( command == "adx" || command == "approxdxcount" );
+        double rate = atof( argv[4] );
+        double threshold = ( argc > 5 ) ? atof( argv[5] ) : -1;
+        double z = ( argc > 6 ) ? atof( argv[6] ) : 1.96;
+        bool stratified = ( argc > 7 && std::string( argv[7] ) == "stratified" );
+        int threads = ( argc > 8 ) ? atoi( argv[8] ) : 8;
+        print_approximate_file_count( r, argv[3], documents, rate, stratified, threshold, z, threads );
+      } else if( command == "wt" || command == "windowtable" ) {
+        REQUIRE_ARGS(5);
+        int maxWindow = atoi( argv[4] );
+        if( maxWindow < 1 ) {
+          r.close();
+          usage();
+          return -1;
+        }
+        int threads = ( argc > 5 ) ? atoi( argv[5] ) : 8;
+        print_window_table( r, argv[3], maxWindow, threads );
+      } else if( command == "tdx" || command == "topdoccount" ) {
+        REQUIRE_ARGS(4);
+        int threads = ( argc > 4 ) ? atoi( argv[4] ) : 8;
+        print_topdoc_file_count( r, argv[3], threads );
       } else if( command == "x" || command == "xcount" ) {
         REQUIRE_ARGS(4);
         std::string expression = argv[3];
@@ -834,6 +2802,24 @@ int main( int argc, char** argv ) {
       } else if( command == "dv" || command == "documentvector" ) {
         REQUIRE_ARGS(4);
         print_document_vector( r, argv[3] );
+      } else if( command == "dnf" || command == "documentnamefile" ||
+                 command == "dtf" || command == "documenttextfile" ||
+                 command == "ddf" || command == "documentdatafile" ||
+                 command == "dvf" || command == "documentvectorfile" ) {
+        REQUIRE_ARGS(4);
+        std::string kind = "dt";
+        if( command == "dnf" || command == "documentnamefile" ) kind = "dn";
+        if( command == "ddf" || command == "documentdatafile" ) kind = "dd";
+        if( command == "dvf" || command == "documentvectorfile" ) kind = "dv";
+        int threads = ( argc > 4 ) ? atoi( argv[4] ) : 8;
+        print_document_file( r, kind, argv[3], threads );
+      } else if( command == "rm" || command == "relevancemodel" ) {
+        REQUIRE_ARGS(4);
+        int fbTerms = ( argc > 4 ) ? atoi( argv[4] ) : 10;
+        double fbMu = ( argc > 5 ) ? atof( argv[5] ) : 0;
+        double fbOrigWeight = ( argc > 6 ) ? atof( argv[6] ) : 0.5;
+        int threads = ( argc > 7 ) ? atoi( argv[7] ) : 8;
+        print_feedback_terms( r, argv[3], fbTerms, fbMu, fbOrigWeight, threads );
       } else if( command == "di" || command == "documentid" ) {
         REQUIRE_ARGS(5);
         print_document_id( r, argv[3], argv[4] );
@@ -843,6 +2829,12 @@ int main( int argc, char** argv ) {
       } else if( command == "v" || command == "vocabulary" ) {
         REQUIRE_ARGS(3);
         print_vocabulary( r );
+      } else if( command == "tsb" || command == "termstatsbuild" ) {
+        REQUIRE_ARGS(4);
+        build_term_stats( r, argv[3] );
+      } else if( command == "ts" || command == "termstats" ) {
+        REQUIRE_ARGS(5);
+        print_term_stats( r, argv[3], argv[4] );
       } else if( command == "vtl" || command == "validate" ) {
         REQUIRE_ARGS(3);
         validate(r);
@@ -858,6 +2850,9 @@ int main( int argc, char** argv ) {
       r.close();
     }
 
+    if( posting_cache().lookups() )
+      posting_cache().printStatistics( std::cerr );
+
     return 0;
   } catch( lemur::api::Exception& e ) {
     LEMUR_ABORT(e);